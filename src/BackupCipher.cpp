@@ -0,0 +1,818 @@
+#include "BackupCipher.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char kMagic[8] = { 'D', 'S', 'Y', 'N', 'C', 'E', 'N', 'C' };
+const uint8_t kFormatVersion = 2;
+const char kKeyInfo[] = "DartSync file key";
+const size_t kAadBytes = BackupCipher::kHeaderBytes + 8 + 1;
+const size_t kNonceBytes = 12;
+
+uint32_t load32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void store32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void store64(uint8_t* p, uint64_t v) {
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+// ---- ChaCha20 (RFC 8439 section 2.3) ----
+
+uint32_t rotl(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+#define QUARTER_ROUND(a, b, c, d)              \
+    a += b; d ^= a; d = rotl(d, 16);           \
+    c += d; b ^= c; b = rotl(b, 12);           \
+    a += b; d ^= a; d = rotl(d, 8);            \
+    c += d; b ^= c; b = rotl(b, 7);
+
+void chachaInit(const uint8_t* key, uint32_t counter, const uint8_t* nonce,
+                uint32_t state[16])
+{
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i) {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; ++i) {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+}
+
+void chachaRounds(const uint32_t state[16], uint32_t x[16]) {
+    std::memcpy(x, state, 16 * sizeof(uint32_t));
+    for (int i = 0; i < 10; ++i) {
+        QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+        x[i] += state[i];
+    }
+}
+
+#undef QUARTER_ROUND
+
+void chachaBlock(const uint8_t* key, uint32_t counter, const uint8_t* nonce,
+                 uint8_t out[64])
+{
+    uint32_t state[16], x[16];
+    chachaInit(key, counter, nonce, state);
+    chachaRounds(state, x);
+    for (int i = 0; i < 16; ++i) {
+        store32(out + 4 * i, x[i]);
+    }
+}
+
+void chachaXor(const uint8_t* key, uint32_t counter, const uint8_t* nonce,
+               uint8_t* data, size_t length)
+{
+    uint32_t state[16], x[16];
+    chachaInit(key, counter, nonce, state);
+
+    // Whole blocks are XORed a word at a time; only the tail goes bytewise
+    for (; length >= 64; data += 64, length -= 64) {
+        chachaRounds(state, x);
+        ++state[12];
+        for (int i = 0; i < 16; ++i) {
+            store32(data + 4 * i, load32(data + 4 * i) ^ x[i]);
+        }
+    }
+    if (length > 0) {
+        uint8_t block[64];
+        chachaRounds(state, x);
+        for (int i = 0; i < 16; ++i) {
+            store32(block + 4 * i, x[i]);
+        }
+        for (size_t i = 0; i < length; ++i) {
+            data[i] ^= block[i];
+        }
+    }
+}
+
+// ---- Poly1305 (RFC 8439 section 2.5), 26-bit limbs ----
+
+class Poly1305 {
+public:
+    explicit Poly1305(const uint8_t key[32]) {
+        r[0] = load32(key) & 0x3ffffff;
+        r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; ++i) {
+            pad[i] = load32(key + 16 + 4 * i);
+        }
+    }
+
+    // Absorbs data followed by zero padding up to a 16-byte boundary
+    void updatePadded(const uint8_t* data, size_t length) {
+        while (length >= 16) {
+            block(data, 1 << 24);
+            data += 16;
+            length -= 16;
+        }
+        if (length > 0) {
+            uint8_t last[16] = {};
+            std::memcpy(last, data, length);
+            block(last, 1 << 24);
+        }
+    }
+
+    void finish(uint8_t tag[16]) {
+        const uint32_t mask = 0x3ffffff;
+        uint32_t c;
+        c = h[1] >> 26; h[1] &= mask; h[2] += c;
+        c = h[2] >> 26; h[2] &= mask; h[3] += c;
+        c = h[3] >> 26; h[3] &= mask; h[4] += c;
+        c = h[4] >> 26; h[4] &= mask; h[0] += c * 5;
+        c = h[0] >> 26; h[0] &= mask; h[1] += c;
+
+        // Compute h - p and keep it if it did not underflow
+        uint32_t g[5];
+        g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= mask;
+        g[1] = h[1] + c; c = g[1] >> 26; g[1] &= mask;
+        g[2] = h[2] + c; c = g[2] >> 26; g[2] &= mask;
+        g[3] = h[3] + c; c = g[3] >> 26; g[3] &= mask;
+        g[4] = h[4] + c - (1u << 26);
+
+        uint32_t select = (g[4] >> 31) - 1;
+        for (int i = 0; i < 5; ++i) {
+            h[i] = (h[i] & ~select) | (g[i] & select);
+        }
+
+        uint32_t w0 = h[0] | (h[1] << 26);
+        uint32_t w1 = (h[1] >> 6) | (h[2] << 20);
+        uint32_t w2 = (h[2] >> 12) | (h[3] << 14);
+        uint32_t w3 = (h[3] >> 18) | (h[4] << 8);
+
+        uint64_t f;
+        f = (uint64_t)w0 + pad[0];             store32(tag, (uint32_t)f);
+        f = (uint64_t)w1 + pad[1] + (f >> 32); store32(tag + 4, (uint32_t)f);
+        f = (uint64_t)w2 + pad[2] + (f >> 32); store32(tag + 8, (uint32_t)f);
+        f = (uint64_t)w3 + pad[3] + (f >> 32); store32(tag + 12, (uint32_t)f);
+    }
+
+private:
+    void block(const uint8_t* m, uint32_t hibit) {
+        const uint32_t mask = 0x3ffffff;
+        h[0] += load32(m) & mask;
+        h[1] += (load32(m + 3) >> 2) & mask;
+        h[2] += (load32(m + 6) >> 4) & mask;
+        h[3] += (load32(m + 9) >> 6) & mask;
+        h[4] += (load32(m + 12) >> 8) | hibit;
+
+        uint64_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+        uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 + (uint64_t)h[2] * s3 +
+                      (uint64_t)h[3] * s2 + (uint64_t)h[4] * s1;
+        uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s4 +
+                      (uint64_t)h[3] * s3 + (uint64_t)h[4] * s2;
+        uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] +
+                      (uint64_t)h[3] * s4 + (uint64_t)h[4] * s3;
+        uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] +
+                      (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s4;
+        uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] +
+                      (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+
+        uint64_t c;
+        c = d0 >> 26; h[0] = (uint32_t)d0 & mask; d1 += c;
+        c = d1 >> 26; h[1] = (uint32_t)d1 & mask; d2 += c;
+        c = d2 >> 26; h[2] = (uint32_t)d2 & mask; d3 += c;
+        c = d3 >> 26; h[3] = (uint32_t)d3 & mask; d4 += c;
+        c = d4 >> 26; h[4] = (uint32_t)d4 & mask;
+        h[0] += (uint32_t)c * 5;
+        c = h[0] >> 26; h[0] &= mask; h[1] += (uint32_t)c;
+    }
+
+    uint32_t r[5];
+    uint32_t h[5] = {};
+    uint32_t pad[4];
+};
+
+// ChaCha20-Poly1305 tag over aad and ciphertext (RFC 8439 section 2.8)
+void chachaPolyTag(const uint8_t* key, const uint8_t* nonce,
+                   const uint8_t* aad, size_t aadLength,
+                   const uint8_t* cipherText, size_t length, uint8_t tag[16])
+{
+    uint8_t oneTimeKey[64];
+    chachaBlock(key, 0, nonce, oneTimeKey);
+
+    Poly1305 mac(oneTimeKey);
+    mac.updatePadded(aad, aadLength);
+    mac.updatePadded(cipherText, length);
+
+    uint8_t lengths[16];
+    store64(lengths, aadLength);
+    store64(lengths + 8, length);
+    mac.updatePadded(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+// ---- SHA-256 (FIPS 180-4), HMAC (RFC 2104), HKDF (RFC 5869) ----
+
+class Sha256 {
+public:
+    void update(const uint8_t* data, size_t length) {
+        total += length;
+        while (length > 0) {
+            size_t n = std::min(length, sizeof(buffer) - used);
+            std::memcpy(buffer + used, data, n);
+            used += n;
+            data += n;
+            length -= n;
+            if (used == sizeof(buffer)) {
+                block(buffer);
+                used = 0;
+            }
+        }
+    }
+
+    void finish(uint8_t digest[32]) {
+        uint64_t bits = total * 8;
+        uint8_t pad[72] = { 0x80 };
+        size_t padLength = (used < 56 ? 56 : 120) - used;
+        for (int i = 0; i < 8; ++i) {
+            pad[padLength + i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        update(pad, padLength + 8);
+        for (int i = 0; i < 8; ++i) {
+            digest[4 * i]     = (uint8_t)(h[i] >> 24);
+            digest[4 * i + 1] = (uint8_t)(h[i] >> 16);
+            digest[4 * i + 2] = (uint8_t)(h[i] >> 8);
+            digest[4 * i + 3] = (uint8_t)h[i];
+        }
+    }
+
+private:
+    static uint32_t rotr(uint32_t v, int n) {
+        return (v >> n) | (v << (32 - n));
+    }
+
+    void block(const uint8_t* m) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = ((uint32_t)m[4 * i] << 24) | ((uint32_t)m[4 * i + 1] << 16) |
+                   ((uint32_t)m[4 * i + 2] << 8) | (uint32_t)m[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                          ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    uint8_t buffer[64];
+    size_t used = 0;
+    uint64_t total = 0;
+};
+
+void hmacSha256(const uint8_t* key, size_t keyLength,
+                const uint8_t* data, size_t length, uint8_t mac[32])
+{
+    uint8_t block[64] = {};
+    if (keyLength > sizeof(block)) {
+        Sha256 hash;
+        hash.update(key, keyLength);
+        hash.finish(block);
+    }
+    else {
+        std::memcpy(block, key, keyLength);
+    }
+
+    uint8_t pad[64];
+    for (int i = 0; i < 64; ++i) pad[i] = block[i] ^ 0x36;
+    Sha256 inner;
+    inner.update(pad, sizeof(pad));
+    inner.update(data, length);
+    uint8_t innerDigest[32];
+    inner.finish(innerDigest);
+
+    for (int i = 0; i < 64; ++i) pad[i] = block[i] ^ 0x5c;
+    Sha256 outer;
+    outer.update(pad, sizeof(pad));
+    outer.update(innerDigest, sizeof(innerDigest));
+    outer.finish(mac);
+}
+
+// HKDF-SHA256 producing a single 32-byte output block
+void hkdfSha256(const uint8_t* ikm, size_t ikmLength,
+                const uint8_t* salt, size_t saltLength,
+                const uint8_t* info, size_t infoLength, uint8_t okm[32])
+{
+    uint8_t prk[32];
+    hmacSha256(salt, saltLength, ikm, ikmLength, prk);
+
+    std::vector<uint8_t> expand(info, info + infoLength);
+    expand.push_back(0x01);
+    hmacSha256(prk, sizeof(prk), expand.data(), expand.size(), okm);
+    std::fill(std::begin(prk), std::end(prk), 0);
+}
+
+bool tagsEqual(const uint8_t* a, const uint8_t* b) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < BackupCipher::kTagBytes; ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// Nonces only have to be unique per file key, so the segment index is enough
+void makeNonce(uint64_t index, uint8_t nonce[12]) {
+    store64(nonce, index);
+    store32(nonce + 8, 0);
+}
+
+void makeAad(const std::array<uint8_t, BackupCipher::kHeaderBytes>& header,
+             uint64_t index, bool final, uint8_t aad[kAadBytes])
+{
+    // Binding the index and final flag rejects reordered or truncated segments
+    std::memcpy(aad, header.data(), header.size());
+    store64(aad + header.size(), index);
+    aad[kAadBytes - 1] = final ? 1 : 0;
+}
+
+void randomBytes(uint8_t* out, size_t length) {
+#ifdef _WIN32
+    if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, out, (ULONG)length,
+                                        BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+        throw std::runtime_error("BCryptGenRandom failed");
+    }
+#else
+    std::ifstream urandom("/dev/urandom", std::ios::binary);
+    if (!urandom.read(reinterpret_cast<char*>(out), (std::streamsize)length)) {
+        throw std::runtime_error("cannot read /dev/urandom");
+    }
+#endif
+}
+
+#ifdef _WIN32
+bool cpuHasAes() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 25)) != 0;
+#else
+    unsigned int a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES) != 0;
+#endif
+#elif defined(_M_ARM64)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+int hexValue(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+BackupCipher::BackupCipher(const std::string& keyFile) {
+    std::ifstream in(keyFile, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("cannot open key file " + keyFile);
+    }
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+    if (contents.size() == kKeyBytes) {
+        std::memcpy(m_key.data(), contents.data(), kKeyBytes);
+    }
+    else {
+        std::string hex;
+        for (char ch : contents) {
+            if (!std::isspace((unsigned char)ch)) hex.push_back(ch);
+        }
+        if (hex.size() != kKeyBytes * 2) {
+            throw std::runtime_error("key file must hold 32 raw bytes or 64 hex digits");
+        }
+        for (size_t i = 0; i < kKeyBytes; ++i) {
+            int hi = hexValue(hex[2 * i]);
+            int lo = hexValue(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) {
+                throw std::runtime_error("key file contains non-hex characters");
+            }
+            m_key[i] = (uint8_t)((hi << 4) | lo);
+        }
+    }
+    std::fill(contents.begin(), contents.end(), '\0');
+
+#ifdef _WIN32
+    // AES is always opened so AES backups can be restored on any machine;
+    // new files only use it when the CPU accelerates it.
+    BCRYPT_ALG_HANDLE provider = nullptr;
+    if (BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&provider, BCRYPT_AES_ALGORITHM,
+                                                   nullptr, 0))) {
+        if (BCRYPT_SUCCESS(BCryptSetProperty(provider, BCRYPT_CHAINING_MODE,
+                                             (PUCHAR)BCRYPT_CHAIN_MODE_GCM,
+                                             sizeof(BCRYPT_CHAIN_MODE_GCM), 0))) {
+            m_aesProvider = provider;
+        }
+        else {
+            BCryptCloseAlgorithmProvider(provider, 0);
+        }
+    }
+    if (m_aesProvider && cpuHasAes()) {
+        m_algorithm = Algorithm::Aes256Gcm;
+    }
+#endif
+}
+
+BackupCipher::~BackupCipher() {
+#ifdef _WIN32
+    if (m_aesProvider) BCryptCloseAlgorithmProvider((BCRYPT_ALG_HANDLE)m_aesProvider, 0);
+#endif
+    volatile uint8_t* key = m_key.data();
+    for (size_t i = 0; i < kKeyBytes; ++i) {
+        key[i] = 0;
+    }
+}
+
+BackupCipher::FileKey::~FileKey() {
+#ifdef _WIN32
+    if (aesKey) BCryptDestroyKey((BCRYPT_KEY_HANDLE)aesKey);
+#endif
+    volatile uint8_t* bytes = key.data();
+    for (size_t i = 0; i < kKeyBytes; ++i) {
+        bytes[i] = 0;
+    }
+}
+
+void BackupCipher::deriveFileKey(const Header& header, FileKey& fileKey) const {
+    // Info binds the key to the header fields in front of the salt
+    uint8_t info[sizeof(kKeyInfo) - 1 + 16];
+    std::memcpy(info, kKeyInfo, sizeof(kKeyInfo) - 1);
+    std::memcpy(info + sizeof(kKeyInfo) - 1, header.raw.data(), 16);
+    hkdfSha256(m_key.data(), m_key.size(), header.salt.data(), header.salt.size(),
+               info, sizeof(info), fileKey.key.data());
+
+#ifdef _WIN32
+    if (header.algorithm == Algorithm::Aes256Gcm && m_aesProvider) {
+        BCRYPT_KEY_HANDLE key = nullptr;
+        if (!BCRYPT_SUCCESS(BCryptGenerateSymmetricKey((BCRYPT_ALG_HANDLE)m_aesProvider,
+                                                       &key, nullptr, 0,
+                                                       fileKey.key.data(),
+                                                       (ULONG)kKeyBytes, 0))) {
+            throw std::runtime_error("cannot create AES-GCM key");
+        }
+        fileKey.aesKey = key;
+    }
+#endif
+}
+
+const char* BackupCipher::name(Algorithm algorithm) {
+    switch (algorithm) {
+        case Algorithm::Aes256Gcm:        return "AES-256-GCM";
+        case Algorithm::ChaCha20Poly1305: return "ChaCha20-Poly1305";
+    }
+    return "unknown";
+}
+
+void BackupCipher::encryptFile(const fs::path& source, const fs::path& destination) const {
+    std::ifstream in(source, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("cannot open " + source.string());
+    }
+    std::ofstream out(destination, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot create " + destination.string());
+    }
+
+    // A partial .dse must never be left behind: it could carry a valid
+    // final tag on a truncated file
+    try {
+        Header header = makeHeader();
+        FileKey fileKey;
+        deriveFileKey(header, fileKey);
+        out.write(reinterpret_cast<const char*>(header.raw.data()), header.raw.size());
+
+        std::vector<uint8_t> buffer(kSegmentBytes + kTagBytes);
+        char* bytes = reinterpret_cast<char*>(buffer.data());
+
+        // Empty files still get one (empty) final segment so truncation is detectable
+        for (uint64_t index = 0; ; ++index) {
+            in.read(bytes, kSegmentBytes);
+            size_t length = (size_t)in.gcount();
+
+            // Only a clean end of file may produce the final segment
+            bool final = in.eof() ||
+                         in.peek() == std::ifstream::traits_type::eof();
+            if (in.bad() || (length < kSegmentBytes && !in.eof())) {
+                throw std::runtime_error("read error on " + source.string());
+            }
+
+            seal(header, fileKey, index, final, buffer.data(), length,
+                 buffer.data() + length);
+            out.write(bytes, (std::streamsize)(length + kTagBytes));
+            if (!out) {
+                throw std::runtime_error("write error on " + destination.string());
+            }
+
+            if (final) break;
+        }
+
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("write error on " + destination.string());
+        }
+    }
+    catch (...) {
+        out.close();
+        std::error_code ec;
+        fs::remove(destination, ec);
+        throw;
+    }
+}
+
+void BackupCipher::decryptFile(const fs::path& source, const fs::path& destination) const {
+    std::ifstream in(source, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("cannot open " + source.string());
+    }
+    uintmax_t fileBytes = fs::file_size(source);
+
+    uint8_t raw[kHeaderBytes];
+    if (!in.read(reinterpret_cast<char*>(raw), kHeaderBytes)) {
+        throw std::runtime_error("missing header in " + source.string());
+    }
+    Header header = parseHeader(raw);
+
+    uintmax_t stride = (uintmax_t)header.segmentBytes + kTagBytes;
+    uintmax_t segments = fileBytes > kHeaderBytes
+        ? (fileBytes - kHeaderBytes + stride - 1) / stride
+        : 0;
+    if (segments == 0) {
+        throw std::runtime_error("truncated file " + source.string());
+    }
+
+    FileKey fileKey;
+    deriveFileKey(header, fileKey);
+
+    std::ofstream out(destination, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot create " + destination.string());
+    }
+
+    // Don't leave partially restored plaintext behind on a bad segment
+    try {
+        std::vector<uint8_t> plain;
+        for (uint64_t index = 0; index < segments; ++index) {
+            openSegment(in, header, fileKey, index, fileBytes, plain);
+            out.write(reinterpret_cast<const char*>(plain.data()), (std::streamsize)plain.size());
+        }
+
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("write error on " + destination.string());
+        }
+    }
+    catch (...) {
+        out.close();
+        std::error_code ec;
+        fs::remove(destination, ec);
+        throw;
+    }
+}
+
+std::vector<uint8_t> BackupCipher::readSegment(const fs::path& source, uint64_t index) const {
+    std::ifstream in(source, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("cannot open " + source.string());
+    }
+
+    uint8_t raw[kHeaderBytes];
+    if (!in.read(reinterpret_cast<char*>(raw), kHeaderBytes)) {
+        throw std::runtime_error("missing header in " + source.string());
+    }
+    Header header = parseHeader(raw);
+    FileKey fileKey;
+    deriveFileKey(header, fileKey);
+
+    std::vector<uint8_t> plain;
+    openSegment(in, header, fileKey, index, fs::file_size(source), plain);
+    return plain;
+}
+
+BackupCipher::Header BackupCipher::makeHeader() const {
+    // magic[8] | algorithm | version | reserved[2] | segment size (LE) | salt[16]
+    Header header;
+    header.algorithm = m_algorithm;
+    header.segmentBytes = kSegmentBytes;
+    randomBytes(header.salt.data(), header.salt.size());
+
+    header.raw.fill(0);
+    std::memcpy(header.raw.data(), kMagic, sizeof(kMagic));
+    header.raw[8] = (uint8_t)header.algorithm;
+    header.raw[9] = kFormatVersion;
+    store32(header.raw.data() + 12, header.segmentBytes);
+    std::memcpy(header.raw.data() + 16, header.salt.data(), header.salt.size());
+    return header;
+}
+
+BackupCipher::Header BackupCipher::parseHeader(const uint8_t* raw) {
+    if (std::memcmp(raw, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("not an encrypted backup file");
+    }
+    if (raw[9] != kFormatVersion) {
+        throw std::runtime_error("unsupported encrypted backup format version");
+    }
+
+    Header header;
+    std::memcpy(header.raw.data(), raw, kHeaderBytes);
+    header.algorithm = (Algorithm)raw[8];
+    header.segmentBytes = load32(raw + 12);
+    std::memcpy(header.salt.data(), raw + 16, header.salt.size());
+
+    if (header.algorithm != Algorithm::Aes256Gcm &&
+        header.algorithm != Algorithm::ChaCha20Poly1305) {
+        throw std::runtime_error("unknown encryption algorithm in header");
+    }
+    if (header.segmentBytes == 0 || header.segmentBytes > 64 * 1024 * 1024) {
+        throw std::runtime_error("invalid segment size in header");
+    }
+    return header;
+}
+
+void BackupCipher::openSegment(std::istream& in, const Header& header, const FileKey& fileKey,
+                               uint64_t index, uintmax_t fileBytes,
+                               std::vector<uint8_t>& out) const
+{
+    uintmax_t stride = (uintmax_t)header.segmentBytes + kTagBytes;
+    uintmax_t segments = fileBytes > kHeaderBytes
+        ? (fileBytes - kHeaderBytes + stride - 1) / stride
+        : 0;
+    if (index >= segments) {
+        throw std::runtime_error("segment " + std::to_string(index) + " is past end of file");
+    }
+
+    uintmax_t offset = kHeaderBytes + index * stride;
+    size_t length = (size_t)std::min(stride, fileBytes - offset);
+    if (length < kTagBytes) {
+        throw std::runtime_error("truncated segment " + std::to_string(index));
+    }
+
+    out.resize(length);
+    in.seekg((std::streamoff)offset);
+    if (!in.read(reinterpret_cast<char*>(out.data()), (std::streamsize)length)) {
+        throw std::runtime_error("read error on segment " + std::to_string(index));
+    }
+
+    size_t plainLength = length - kTagBytes;
+    bool final = index == segments - 1;
+    if (!open(header, fileKey, index, final, out.data(), plainLength,
+              out.data() + plainLength)) {
+        throw std::runtime_error("authentication failed on segment " + std::to_string(index));
+    }
+    out.resize(plainLength);
+}
+
+void BackupCipher::seal(const Header& header, const FileKey& fileKey, uint64_t index, bool final,
+                        uint8_t* data, size_t length, uint8_t* tag) const
+{
+    uint8_t nonce[kNonceBytes];
+    uint8_t aad[kAadBytes];
+    makeNonce(index, nonce);
+    makeAad(header.raw, index, final, aad);
+
+    if (header.algorithm == Algorithm::ChaCha20Poly1305) {
+        chachaXor(fileKey.key.data(), 1, nonce, data, length);
+        chachaPolyTag(fileKey.key.data(), nonce, aad, kAadBytes, data, length, tag);
+        return;
+    }
+
+#ifdef _WIN32
+    if (fileKey.aesKey) {
+        BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+        BCRYPT_INIT_AUTH_MODE_INFO(info);
+        info.pbNonce = nonce;
+        info.cbNonce = (ULONG)kNonceBytes;
+        info.pbAuthData = aad;
+        info.cbAuthData = (ULONG)kAadBytes;
+        info.pbTag = tag;
+        info.cbTag = (ULONG)kTagBytes;
+
+        ULONG written = 0;
+        if (!BCRYPT_SUCCESS(BCryptEncrypt((BCRYPT_KEY_HANDLE)fileKey.aesKey, data, (ULONG)length,
+                                          &info, nullptr, 0, data, (ULONG)length,
+                                          &written, 0))) {
+            throw std::runtime_error("AES-GCM encryption failed");
+        }
+        return;
+    }
+#endif
+    throw std::runtime_error("AES-256-GCM is not available on this system");
+}
+
+bool BackupCipher::open(const Header& header, const FileKey& fileKey, uint64_t index, bool final,
+                        uint8_t* data, size_t length, const uint8_t* tag) const
+{
+    uint8_t nonce[kNonceBytes];
+    uint8_t aad[kAadBytes];
+    makeNonce(index, nonce);
+    makeAad(header.raw, index, final, aad);
+
+    if (header.algorithm == Algorithm::ChaCha20Poly1305) {
+        uint8_t expected[kTagBytes];
+        chachaPolyTag(fileKey.key.data(), nonce, aad, kAadBytes, data, length, expected);
+        if (!tagsEqual(expected, tag)) {
+            return false;
+        }
+        chachaXor(fileKey.key.data(), 1, nonce, data, length);
+        return true;
+    }
+
+#ifdef _WIN32
+    if (fileKey.aesKey) {
+        uint8_t tagCopy[kTagBytes];
+        std::memcpy(tagCopy, tag, kTagBytes);
+
+        BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+        BCRYPT_INIT_AUTH_MODE_INFO(info);
+        info.pbNonce = nonce;
+        info.cbNonce = (ULONG)kNonceBytes;
+        info.pbAuthData = aad;
+        info.cbAuthData = (ULONG)kAadBytes;
+        info.pbTag = tagCopy;
+        info.cbTag = (ULONG)kTagBytes;
+
+        ULONG written = 0;
+        return BCRYPT_SUCCESS(BCryptDecrypt((BCRYPT_KEY_HANDLE)fileKey.aesKey, data, (ULONG)length,
+                                            &info, nullptr, 0, data, (ULONG)length,
+                                            &written, 0));
+    }
+#endif
+    throw std::runtime_error("AES-256-GCM is not available on this system");
+}
@@ -0,0 +1,104 @@
+#ifndef BACKUPCIPHER_H
+#define BACKUPCIPHER_H
+
+#include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Authenticated encryption of backup files in fixed-size segments.
+//
+// Each encrypted file is a 32-byte header followed by segments of
+// kSegmentBytes ciphertext plus a 16-byte tag (the last one may be shorter).
+// Every segment is sealed on its own, so files stream with bounded memory and
+// any segment can be restored without reading the ones before it.
+//
+// A BackupCipher is not shared between threads; give each worker its own.
+class BackupCipher {
+public:
+    enum class Algorithm : uint8_t {
+        Aes256Gcm = 1,        // Windows CNG, used when the CPU has AES-NI
+        ChaCha20Poly1305 = 2  // Portable fallback
+    };
+
+    static constexpr size_t kKeyBytes = 32;
+    static constexpr size_t kTagBytes = 16;
+    static constexpr size_t kHeaderBytes = 32;
+    static constexpr uint32_t kSegmentBytes = 64 * 1024;
+
+    // Extension appended to encrypted backup files
+    static constexpr const char* kExtension = ".dse";
+
+    // Loads a 32-byte key from keyFile, either raw or as 64 hex digits.
+    // Throws std::runtime_error if the file is missing or malformed.
+    explicit BackupCipher(const std::string& keyFile);
+    ~BackupCipher();
+
+    BackupCipher(const BackupCipher&) = delete;
+    BackupCipher& operator=(const BackupCipher&) = delete;
+
+    // Algorithm used for newly encrypted files
+    Algorithm algorithm() const { return m_algorithm; }
+
+    // Human-readable name for console output
+    static const char* name(Algorithm algorithm);
+
+    // Encrypts source into destination. Throws std::runtime_error on failure.
+    void encryptFile(const std::filesystem::path& source,
+                     const std::filesystem::path& destination) const;
+
+    // Decrypts a whole file, verifying every segment.
+    // Throws std::runtime_error on I/O errors or if any segment was tampered with.
+    void decryptFile(const std::filesystem::path& source,
+                     const std::filesystem::path& destination) const;
+
+    // Decrypts only the segment at index (plaintext offset index * kSegmentBytes)
+    std::vector<uint8_t> readSegment(const std::filesystem::path& source,
+                                     uint64_t index) const;
+
+private:
+    struct Header {
+        Algorithm algorithm;
+        uint32_t segmentBytes;
+        std::array<uint8_t, 16> salt;
+        std::array<uint8_t, kHeaderBytes> raw;
+    };
+
+    // Subkey for one file, derived from the master key and the header salt.
+    // Each file gets its own key, so segment nonces only need to be unique
+    // within the file and are simply the segment index.
+    struct FileKey {
+        std::array<uint8_t, kKeyBytes> key{};
+        void* aesKey = nullptr; // BCRYPT_KEY_HANDLE on Windows
+
+        FileKey() = default;
+        FileKey(const FileKey&) = delete;
+        FileKey& operator=(const FileKey&) = delete;
+        ~FileKey();
+    };
+
+    Header makeHeader() const;
+    static Header parseHeader(const uint8_t* raw);
+
+    // HKDF-SHA256 of the master key, salted with the header's salt
+    void deriveFileKey(const Header& header, FileKey& fileKey) const;
+
+    // Reads and decrypts one segment of an already opened file
+    void openSegment(std::istream& in, const Header& header, const FileKey& fileKey,
+                     uint64_t index, uintmax_t fileBytes, std::vector<uint8_t>& out) const;
+
+    // Encrypts data in place and writes the tag
+    void seal(const Header& header, const FileKey& fileKey, uint64_t index, bool final,
+              uint8_t* data, size_t length, uint8_t* tag) const;
+
+    // Decrypts data in place; returns false if the tag does not match
+    bool open(const Header& header, const FileKey& fileKey, uint64_t index, bool final,
+              uint8_t* data, size_t length, const uint8_t* tag) const;
+
+    std::array<uint8_t, kKeyBytes> m_key{};
+    Algorithm m_algorithm = Algorithm::ChaCha20Poly1305;
+    void* m_aesProvider = nullptr; // BCRYPT_ALG_HANDLE on Windows
+};
+
+#endif // BACKUPCIPHER_H
@@ -1,4 +1,6 @@
 #include "BackupManager.h"
+#include "BackupCipher.h"
+#include "ParallelScanner.h"
 #include <filesystem>
 #include <iostream>
 #include <chrono>
@@ -8,6 +10,7 @@
 #include <iomanip>
 #include <sstream>
 #include <mutex>
+#include <memory>
 
 namespace fs = std::filesystem;
 static std::mutex coutMutex;
@@ -20,9 +23,12 @@ void BackupManager::backupOnce(const std::string& sourcePath,
                                const std::string& outputPath,
                                const std::vector<std::string>& fileTypes,
                                const std::string& keyword,
-                               size_t maxFileSizeMB)
+                               size_t maxFileSizeMB,
+                               CopyOrder copyOrder,
+                               const std::string& keyFile)
 {
-    performBackup(sourcePath, outputPath, fileTypes, keyword, maxFileSizeMB);
+    performBackup(sourcePath, outputPath, fileTypes, keyword, maxFileSizeMB,
+                  copyOrder, keyFile);
 }
 
 void BackupManager::backupScheduled(const std::string& sourcePath,
@@ -30,11 +36,14 @@ void BackupManager::backupScheduled(const std::string& sourcePath,
                                     const std::vector<std::string>& fileTypes,
                                     const std::string& keyword,
                                     size_t maxFileSizeMB,
+                                    CopyOrder copyOrder,
+                                    const std::string& keyFile,
                                     const std::string& scheduleType,
                                     int intervalSeconds)
 {
     while (true) {
-        performBackup(sourcePath, outputPath, fileTypes, keyword, maxFileSizeMB);
+        performBackup(sourcePath, outputPath, fileTypes, keyword, maxFileSizeMB,
+                      copyOrder, keyFile);
 
         if (scheduleType == "daily") {
             std::this_thread::sleep_for(std::chrono::hours(24));
@@ -62,9 +71,20 @@ void BackupManager::performBackup(const std::string& sourcePath,
                                   const std::string& outputPath,
                                   const std::vector<std::string>& fileTypes,
                                   const std::string& keyword,
-                                  size_t maxFileSizeMB)
+                                  size_t maxFileSizeMB,
+                                  CopyOrder copyOrder,
+                                  const std::string& keyFile)
 {
     try {
+        // Load the key first so a bad key file fails before anything is written
+        std::unique_ptr<BackupCipher> cipher;
+        if (!keyFile.empty()) {
+            cipher = std::make_unique<BackupCipher>(keyFile);
+            std::lock_guard<std::mutex> lock(coutMutex);
+            std::cout << "Encrypting backup with "
+                      << BackupCipher::name(cipher->algorithm()) << "\n";
+        }
+
         {
             std::lock_guard<std::mutex> lock(coutMutex);
             std::cout << "Generating versioned backup directory...\n";
@@ -79,34 +99,42 @@ void BackupManager::performBackup(const std::string& sourcePath,
             std::cout << "Scanning for files to backup...\n";
         }
 
-        std::vector<fs::path> filesToBackup;
-        uintmax_t totalBytes = 0;
+        // Resolve the copy order up front: directory order needs a sorted
+        // scan, the others sort the list themselves with path as tie-break
+        CopyOrder order = CopyOrderer(copyOrder).resolve(sourcePath);
 
-        for (const auto& entry : fs::recursive_directory_iterator(sourcePath)) {
-            if (fs::is_regular_file(entry.status())) {
+        ParallelScanner scanner;
+        auto scanned = scanner.scan(sourcePath,
+            [&](const fs::directory_entry& entry, uintmax_t& fileSize) {
                 // File type filter
                 if (!fileTypes.empty() &&
                     std::find(fileTypes.begin(), fileTypes.end(),
                               entry.path().extension().string()) == fileTypes.end()) {
-                    continue;
+                    return false;
                 }
 
                 // Keyword filter
                 if (!keyword.empty() &&
                     entry.path().filename().string().find(keyword) == std::string::npos) {
-                    continue;
+                    return false;
                 }
 
                 // File size filter
-                uintmax_t fileSize = fs::file_size(entry.path());
+                fileSize = fs::file_size(entry.path());
                 size_t fileSizeMBCalc = (size_t)(fileSize / (1024 * 1024));
                 if (maxFileSizeMB > 0 && fileSizeMBCalc > maxFileSizeMB) {
-                    continue;
+                    return false;
                 }
+                return true;
+            },
+            order == CopyOrder::Directory);
 
-                filesToBackup.push_back(entry.path());
-                totalBytes += fileSize;
-            }
+        std::vector<fs::path> filesToBackup;
+        uintmax_t totalBytes = 0;
+        filesToBackup.reserve(scanned.size());
+        for (auto& file : scanned) {
+            totalBytes += file.size;
+            filesToBackup.push_back(std::move(file.path));
         }
 
         {
@@ -121,6 +149,13 @@ void BackupManager::performBackup(const std::string& sourcePath,
             return;
         }
 
+        {
+            std::lock_guard<std::mutex> lock(coutMutex);
+            std::cout << "Ordering files for copy: "
+                      << CopyOrderer::name(order) << "\n";
+        }
+        CopyOrderer(order).apply(sourcePath, filesToBackup);
+
         {
             std::lock_guard<std::mutex> lock(coutMutex);
             std::cout << "Starting backup of " << filesToBackup.size() << " files...\n";
@@ -131,6 +166,9 @@ void BackupManager::performBackup(const std::string& sourcePath,
             try {
                 fs::path relativePath = fs::relative(filePath, sourcePath);
                 fs::path destination = fs::path(versionedOutput) / relativePath;
+                if (cipher) {
+                    destination += BackupCipher::kExtension;
+                }
                 fs::create_directories(destination.parent_path());
 
                 {
@@ -141,7 +179,12 @@ void BackupManager::performBackup(const std::string& sourcePath,
                               << destination.filename().string() << "\n";
                 }
 
-                fs::copy_file(filePath, destination, fs::copy_options::overwrite_existing);
+                if (cipher) {
+                    cipher->encryptFile(filePath, destination);
+                }
+                else {
+                    fs::copy_file(filePath, destination, fs::copy_options::overwrite_existing);
+                }
 
                 uintmax_t fileSize = fs::file_size(filePath);
                 bytesCopied += fileSize;
@@ -178,7 +221,79 @@ void BackupManager::performBackup(const std::string& sourcePath,
     }
 }
 
-std::string BackupManager::getVersionedPath(const std::string& destination) {
+void BackupManager::restoreEncrypted(const std::string& backupPath,
+                                     const std::string& outputPath,
+                                     const std::string& keyFile)
+{
+    try {
+        BackupCipher cipher(keyFile);
+
+        std::string restoreOutput = getVersionedPath(outputPath, "Restore");
+        fs::create_directories(restoreOutput);
+
+        {
+            std::lock_guard<std::mutex> lock(coutMutex);
+            std::cout << "Restoring " << backupPath << " into " << restoreOutput << "\n";
+        }
+
+        size_t restored = 0;
+        size_t failed = 0;
+        for (const auto& entry : fs::recursive_directory_iterator(backupPath)) {
+            if (!fs::is_regular_file(entry.status())) {
+                continue;
+            }
+
+            const fs::path& filePath = entry.path();
+            try {
+                fs::path relativePath = fs::relative(filePath, backupPath);
+                fs::path destination = fs::path(restoreOutput) / relativePath;
+                bool encrypted = filePath.extension() == BackupCipher::kExtension;
+                if (encrypted) {
+                    destination.replace_extension();
+                }
+                fs::create_directories(destination.parent_path());
+
+                {
+                    std::lock_guard<std::mutex> lock(coutMutex);
+                    std::cout << "Restoring file: "
+                              << filePath.filename().string()
+                              << " to "
+                              << destination.filename().string() << "\n";
+                }
+
+                if (encrypted) {
+                    cipher.decryptFile(filePath, destination);
+                }
+                else {
+                    fs::copy_file(filePath, destination, fs::copy_options::overwrite_existing);
+                }
+                ++restored;
+            }
+            catch (const std::exception& e) {
+                ++failed;
+                std::lock_guard<std::mutex> lock(coutMutex);
+                std::cerr << "Failed to restore "
+                          << filePath.filename().string()
+                          << ": " << e.what() << "\n";
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(coutMutex);
+        std::cout << "Restore finished: " << restored << " files restored, "
+                  << failed << " failed, in directory: " << restoreOutput << "\n";
+    }
+    catch (const fs::filesystem_error& e) {
+        std::lock_guard<std::mutex> lock(coutMutex);
+        std::cerr << "Filesystem error during restore: " << e.what() << "\n";
+    }
+    catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(coutMutex);
+        std::cerr << "General error during restore: " << e.what() << "\n";
+    }
+}
+
+std::string BackupManager::getVersionedPath(const std::string& destination,
+                                            const std::string& prefix) {
     auto now = std::chrono::system_clock::now();
     std::time_t now_time_t = std::chrono::system_clock::to_time_t(now);
     std::tm tm_now;
@@ -194,7 +309,7 @@ std::string BackupManager::getVersionedPath(const std::string& destination) {
     std::string timestamp = oss.str();
 
     fs::path destPath(destination);
-    fs::path versionedPath = destPath / ("Backup" + timestamp);
+    fs::path versionedPath = destPath / (prefix + timestamp);
     return versionedPath.string();
 }
 
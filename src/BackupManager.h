@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <cstdint> // For uintmax_t
+#include "CopyOrder.h"
 
 class BackupManager {
 public:
@@ -14,7 +15,9 @@ public:
                     const std::string& outputPath,
                     const std::vector<std::string>& fileTypes,
                     const std::string& keyword,
-                    size_t maxFileSizeMB);
+                    size_t maxFileSizeMB,
+                    CopyOrder copyOrder,
+                    const std::string& keyFile);
 
     // Performs a scheduled backup based on the scheduleType and interval
     void backupScheduled(const std::string& sourcePath,
@@ -22,19 +25,30 @@ public:
                          const std::vector<std::string>& fileTypes,
                          const std::string& keyword,
                          size_t maxFileSizeMB,
+                         CopyOrder copyOrder,
+                         const std::string& keyFile,
                          const std::string& scheduleType,
                          int intervalSeconds);
 
+    // Decrypts an encrypted backup directory into a versioned restore
+    // directory under outputPath. Files without the .dse extension are copied as-is.
+    void restoreEncrypted(const std::string& backupPath,
+                          const std::string& outputPath,
+                          const std::string& keyFile);
+
 private:
     // Core backup functionality
     void performBackup(const std::string& sourcePath,
                        const std::string& outputPath,
                        const std::vector<std::string>& fileTypes,
                        const std::string& keyword,
-                       size_t maxFileSizeMB);
+                       size_t maxFileSizeMB,
+                       CopyOrder copyOrder,
+                       const std::string& keyFile);
 
-    // Generates a versioned backup path based on the current timestamp
-    std::string getVersionedPath(const std::string& destination);
+    // Generates a versioned path (prefix + timestamp) under destination
+    std::string getVersionedPath(const std::string& destination,
+                                 const std::string& prefix = "Backup");
 
     // Displays the backup progress based on bytes copied
     void displayProgress(uintmax_t bytesCopied, uintmax_t totalBytes);
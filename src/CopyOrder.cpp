@@ -0,0 +1,242 @@
+#include "CopyOrder.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+CopyOrderer::CopyOrderer(CopyOrder order)
+    : m_order(order)
+{
+}
+
+void CopyOrderer::apply(const std::string& sourcePath,
+                        std::vector<fs::path>& files) const
+{
+    CopyOrder order = resolve(sourcePath);
+    if (order == CopyOrder::Directory || files.size() < 2) {
+        return;
+    }
+
+    std::vector<FileKey> keys(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        keys[i] = readKey(files[i], order);
+        keys[i].scanIndex = i;
+    }
+
+    if (order == CopyOrder::SizeClass) {
+        // Large files go first, biggest at the front, so a long copy never
+        // ends up as the tail. Small files follow as one batch in inode order.
+        std::sort(keys.begin(), keys.end(),
+            [&files](const FileKey& a, const FileKey& b) {
+                bool aLarge = a.size >= kSmallFileBytes;
+                bool bLarge = b.size >= kSmallFileBytes;
+                if (aLarge != bLarge) return aLarge;
+                if (aLarge && a.size != b.size) return a.size > b.size;
+                if (!aLarge && a.location != b.location) return a.location < b.location;
+                return files[a.scanIndex] < files[b.scanIndex];
+            });
+    }
+    else {
+        // Physical offsets and inode numbers are never compared: files without
+        // an extent go after the mapped ones. Ties fall back to path order so
+        // the result never depends on the order the scan happened to produce.
+        std::sort(keys.begin(), keys.end(),
+            [&files](const FileKey& a, const FileKey& b) {
+                if (a.unmapped != b.unmapped) return b.unmapped;
+                if (a.location != b.location) return a.location < b.location;
+                return files[a.scanIndex] < files[b.scanIndex];
+            });
+    }
+
+    std::vector<fs::path> ordered;
+    ordered.reserve(files.size());
+    for (const auto& key : keys) {
+        ordered.push_back(std::move(files[key.scanIndex]));
+    }
+    files.swap(ordered);
+}
+
+CopyOrder CopyOrderer::resolve(const std::string& sourcePath) const {
+    if (m_order != CopyOrder::Auto) {
+        return m_order;
+    }
+    return isRotational(sourcePath) ? CopyOrder::Extent : CopyOrder::Directory;
+}
+
+const char* CopyOrderer::name(CopyOrder order) {
+    switch (order) {
+        case CopyOrder::Auto:      return "auto";
+        case CopyOrder::Directory: return "directory";
+        case CopyOrder::Inode:     return "inode";
+        case CopyOrder::Extent:    return "extent";
+        case CopyOrder::SizeClass: return "size-class";
+    }
+    return "unknown";
+}
+
+#ifdef _WIN32
+
+bool CopyOrderer::isRotational(const std::string& path) {
+    std::wstring widePath = fs::absolute(fs::path(path)).wstring();
+
+    wchar_t mountPoint[MAX_PATH];
+    if (!GetVolumePathNameW(widePath.c_str(), mountPoint, MAX_PATH)) {
+        return false;
+    }
+
+    wchar_t volumeName[MAX_PATH];
+    if (!GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)) {
+        return false; // Network shares have no local volume
+    }
+
+    // CreateFileW wants the volume without its trailing backslash
+    std::wstring device(volumeName);
+    if (!device.empty() && device.back() == L'\\') {
+        device.pop_back();
+    }
+
+    HANDLE hVolume = CreateFileW(device.c_str(), 0,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hVolume == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+
+    DEVICE_SEEK_PENALTY_DESCRIPTOR penalty = {};
+    DWORD returned = 0;
+    BOOL ok = DeviceIoControl(hVolume, IOCTL_STORAGE_QUERY_PROPERTY,
+                              &query, sizeof(query),
+                              &penalty, sizeof(penalty),
+                              &returned, nullptr);
+    CloseHandle(hVolume);
+
+    return ok && returned >= sizeof(penalty) && penalty.IncursSeekPenalty;
+}
+
+CopyOrderer::FileKey CopyOrderer::readKey(const fs::path& file, CopyOrder order) {
+    FileKey key;
+    key.unmapped = order == CopyOrder::Extent;
+
+    HANDLE hFile = CreateFileW(file.wstring().c_str(), FILE_READ_ATTRIBUTES,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return key;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (GetFileInformationByHandle(hFile, &info)) {
+        key.size = ((uintmax_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        // NTFS keeps the MFT reuse count in the top 16 bits; only the low 48
+        // bits are the record number, which is what tracks disk position
+        key.location = (((uintmax_t)info.nFileIndexHigh << 32) | info.nFileIndexLow) &
+                       0x0000FFFFFFFFFFFFull;
+    }
+
+    if (order == CopyOrder::Extent) {
+        // Only the first extent matters; ERROR_MORE_DATA still fills it in.
+        // Files resident in the MFT, sparse starts (LCN -1) and failed lookups
+        // stay unmapped and keep the file index as their key.
+        STARTING_VCN_INPUT_BUFFER input = {};
+        RETRIEVAL_POINTERS_BUFFER output = {};
+        DWORD returned = 0;
+        BOOL ok = DeviceIoControl(hFile, FSCTL_GET_RETRIEVAL_POINTERS,
+                                  &input, sizeof(input),
+                                  &output, sizeof(output),
+                                  &returned, nullptr);
+        if ((ok || GetLastError() == ERROR_MORE_DATA) && output.ExtentCount > 0 &&
+            output.Extents[0].Lcn.QuadPart >= 0) {
+            key.location = (uintmax_t)output.Extents[0].Lcn.QuadPart;
+            key.unmapped = false;
+        }
+    }
+
+    CloseHandle(hFile);
+    return key;
+}
+
+#else
+
+bool CopyOrderer::isRotational(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    // Partitions have no queue/ of their own, so fall back to the parent disk
+    std::string base = "/sys/dev/block/" + std::to_string(major(st.st_dev)) +
+                       ":" + std::to_string(minor(st.st_dev));
+    for (const char* suffix : { "/queue/rotational", "/../queue/rotational" }) {
+        std::ifstream in(base + suffix);
+        int rotational = 0;
+        if (in >> rotational) {
+            return rotational != 0;
+        }
+    }
+    return false;
+}
+
+CopyOrderer::FileKey CopyOrderer::readKey(const fs::path& file, CopyOrder order) {
+    FileKey key;
+    key.unmapped = order == CopyOrder::Extent;
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return key;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        key.size = (uintmax_t)st.st_size;
+        key.location = (uintmax_t)st.st_ino;
+    }
+
+#ifdef FS_IOC_FIEMAP
+    if (order == CopyOrder::Extent) {
+        // Ask for a single extent: only the start of the file matters.
+        // Empty, inline and delayed-allocation files have no usable offset,
+        // and neither do filesystems without FIEMAP; those stay unmapped
+        // and keep the inode number as their key.
+        alignas(struct fiemap) char buffer[sizeof(struct fiemap) +
+                                          sizeof(struct fiemap_extent)] = {};
+        auto* map = reinterpret_cast<struct fiemap*>(buffer);
+        map->fm_start = 0;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_extent_count = 1;
+
+        const uint32_t noOffset = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE;
+        if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0 &&
+            (map->fm_extents[0].fe_flags & noOffset) == 0) {
+            key.location = (uintmax_t)map->fm_extents[0].fe_physical;
+            key.unmapped = false;
+        }
+    }
+#else
+    (void)order; // No extent map here; inode order is the closest match
+#endif
+
+    close(fd);
+    return key;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef COPYORDER_H
+#define COPYORDER_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint> // For uintmax_t
+
+// Order in which scanned files are handed to the copy loop
+enum class CopyOrder {
+    Auto,       // Pick Extent on rotational sources, Directory otherwise
+    Directory,  // Keep the order the scan produced
+    Inode,      // Sort by inode / NTFS file index
+    Extent,     // Sort by physical offset of the first extent
+    SizeClass   // Largest files first, then small files in inode order
+};
+
+// Reorders scanned files to reduce seeking on the source device
+class CopyOrderer {
+public:
+    explicit CopyOrderer(CopyOrder order = CopyOrder::Auto);
+
+    // Sorts files in place according to the configured order.
+    // sourcePath is used to detect the device type when the order is Auto.
+    void apply(const std::string& sourcePath,
+               std::vector<std::filesystem::path>& files) const;
+
+    // Resolves Auto to a concrete order for the given source
+    CopyOrder resolve(const std::string& sourcePath) const;
+
+    // Returns true if the device holding path is a spinning disk
+    static bool isRotational(const std::string& path);
+
+    // Human-readable name for console output
+    static const char* name(CopyOrder order);
+
+    // Files at or above this size are ordered largest-first by SizeClass
+    static constexpr uintmax_t kSmallFileBytes = 1024 * 1024;
+
+private:
+    struct FileKey {
+        uintmax_t location = 0;  // inode or physical offset
+        uintmax_t size = 0;
+        size_t scanIndex = 0;    // position in the input list
+        bool unmapped = false;   // Extent order only: no physical offset, so
+                                 // location is the inode and it sorts last
+    };
+
+    // Looks up the sort key for a single file; location is 0 on failure
+    static FileKey readKey(const std::filesystem::path& file, CopyOrder order);
+
+    CopyOrder m_order;
+};
+
+#endif // COPYORDER_H
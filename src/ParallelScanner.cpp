@@ -0,0 +1,332 @@
+#include "ParallelScanner.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct WorkItem {
+    fs::path dir;
+    uint64_t device;
+};
+
+// Identifies the mount a directory lives on, for the per-mount cap
+uint64_t deviceOf(const fs::path& dir) {
+#ifdef _WIN32
+    // Drive letter or UNC share. Junctions are never descended into, so a
+    // volume mounted on a folder is not reached through the walk
+    return std::hash<std::wstring>()(dir.root_name().wstring());
+#else
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0) {
+        return 0; // Listing it will report the error
+    }
+    return (uint64_t)st.st_dev;
+#endif
+}
+
+// Collects the mount points below root, spelled the way the walk will
+// produce them, so only those directories need a device lookup.
+// Returns false if the mount table is unavailable.
+bool loadMountPoints(const fs::path& root, std::unordered_set<std::string>& mountPoints) {
+#ifdef _WIN32
+    // Devices are keyed by root name, which every subdirectory shares
+    (void)root;
+    (void)mountPoints;
+    return true;
+#elif defined(__linux__)
+    std::error_code ec;
+    fs::path canonicalRoot = fs::canonical(root, ec);
+    std::ifstream mountInfo("/proc/self/mountinfo");
+    if (ec || !mountInfo) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(mountInfo, line)) {
+        // Fifth field is the mount point, with spaces etc. escaped as \ooo
+        std::istringstream fields(line);
+        std::string field;
+        for (int i = 0; i < 5; ++i) {
+            fields >> field;
+        }
+        if (!fields) {
+            continue;
+        }
+
+        std::string mountPoint;
+        for (size_t i = 0; i < field.size(); ++i) {
+            if (field[i] == '\\' && i + 3 < field.size()) {
+                mountPoint.push_back((char)std::stoi(field.substr(i + 1, 3), nullptr, 8));
+                i += 3;
+            }
+            else {
+                mountPoint.push_back(field[i]);
+            }
+        }
+
+        fs::path relative = fs::path(mountPoint).lexically_relative(canonicalRoot);
+        if (relative.empty() || relative == "." || *relative.begin() == "..") {
+            continue;
+        }
+        mountPoints.insert((root / relative).string());
+    }
+    return true;
+#else
+    (void)root;
+    (void)mountPoints;
+    return false;
+#endif
+}
+
+} // namespace
+
+struct ParallelScanner::State {
+    struct Worker {
+        std::mutex mutex;
+        std::deque<WorkItem> queue;
+        std::vector<ScannedFile> found;
+    };
+
+    explicit State(size_t threads, const Filter& filter)
+        : workers(threads), accept(filter)
+    {
+        for (auto& worker : workers) {
+            worker = std::make_unique<Worker>();
+        }
+    }
+
+    void push(size_t self, WorkItem item) {
+        ++pending;
+        {
+            std::lock_guard<std::mutex> lock(workers[self]->mutex);
+            workers[self]->queue.push_back(std::move(item));
+        }
+        wake.notify_one();
+    }
+
+    // Own queue is used LIFO to stay depth-first; others are robbed from the front
+    bool take(size_t self, WorkItem& item) {
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.queue.empty()) {
+                item = std::move(own.queue.back());
+                own.queue.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.queue.empty()) {
+                item = std::move(victim.queue.front());
+                victim.queue.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Puts back an item that could not run yet, behind the owner's own work
+    void putBack(size_t self, WorkItem item) {
+        std::lock_guard<std::mutex> lock(workers[self]->mutex);
+        workers[self]->queue.push_front(std::move(item));
+    }
+
+    bool acquireMount(uint64_t device, size_t limit) {
+        std::lock_guard<std::mutex> lock(mountMutex);
+        size_t& active = mountsActive[device];
+        if (limit > 0 && active >= limit) {
+            return false;
+        }
+        ++active;
+        return true;
+    }
+
+    void releaseMount(uint64_t device) {
+        {
+            std::lock_guard<std::mutex> lock(mountMutex);
+            --mountsActive[device];
+        }
+        wake.notify_one();
+    }
+
+    void finishItem() {
+        if (--pending == 0) {
+            wake.notify_all();
+        }
+    }
+
+    void fail(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!firstError) {
+                firstError = error;
+            }
+        }
+        failed = true;
+        wake.notify_all();
+    }
+
+    void idle() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait_for(lock, std::chrono::milliseconds(2));
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    const Filter& accept;
+
+    // Directories queued or being listed; the walk ends when it reaches zero
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> failed{false};
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    std::mutex mountMutex;
+    std::unordered_map<uint64_t, size_t> mountsActive;
+
+    // Read-only once workers start; without it every directory is stat'ed
+    std::unordered_set<std::string> mountPoints;
+    bool haveMountTable = false;
+
+    std::mutex errorMutex;
+    std::exception_ptr firstError;
+};
+
+ParallelScanner::ParallelScanner(size_t threads, size_t maxPerMount)
+    : m_threads(threads), m_maxPerMount(maxPerMount)
+{
+    if (m_threads == 0) {
+        // Listing is latency-bound, so use more threads than cores on small machines
+        m_threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+        // Threads beyond the per-mount cap would only spin on a single device
+        if (m_maxPerMount > 0) {
+            m_threads = std::min(m_threads, m_maxPerMount);
+        }
+    }
+}
+
+std::vector<ParallelScanner::ScannedFile> ParallelScanner::scan(const fs::path& root,
+                                                                const Filter& accept,
+                                                                bool sortedOutput) const
+{
+    State state(m_threads, accept);
+    uint64_t rootDevice = 0;
+    if (m_maxPerMount > 0) {
+        state.haveMountTable = loadMountPoints(root, state.mountPoints);
+        rootDevice = deviceOf(root);
+    }
+    state.push(0, WorkItem{ root, rootDevice });
+
+    std::vector<std::thread> pool;
+    pool.reserve(m_threads);
+    for (size_t i = 0; i < m_threads; ++i) {
+        pool.emplace_back([this, &state, i]() { run(state, i); });
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    if (state.firstError) {
+        std::rethrow_exception(state.firstError);
+    }
+
+    std::vector<ScannedFile> files;
+    size_t total = 0;
+    for (const auto& worker : state.workers) {
+        total += worker->found.size();
+    }
+    files.reserve(total);
+    for (auto& worker : state.workers) {
+        std::move(worker->found.begin(), worker->found.end(), std::back_inserter(files));
+    }
+
+    if (sortedOutput) {
+        std::sort(files.begin(), files.end(),
+            [](const ScannedFile& a, const ScannedFile& b) {
+                return a.path < b.path;
+            });
+    }
+    return files;
+}
+
+void ParallelScanner::run(State& state, size_t self) const {
+    while (!state.failed) {
+        WorkItem item;
+        if (!state.take(self, item)) {
+            if (state.pending == 0) {
+                return;
+            }
+            state.idle();
+            continue;
+        }
+
+        if (!state.acquireMount(item.device, m_maxPerMount)) {
+            state.putBack(self, std::move(item));
+            state.idle();
+            continue;
+        }
+
+        try {
+            listDirectory(state, self, item.dir, item.device);
+        }
+        catch (...) {
+            state.fail(std::current_exception());
+        }
+
+        state.releaseMount(item.device);
+        state.finishItem();
+    }
+}
+
+void ParallelScanner::listDirectory(State& state, size_t self,
+                                    const fs::path& dir, uint64_t device) const {
+    auto& found = state.workers[self]->found;
+
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (state.failed) {
+            return;
+        }
+
+        // Same rule as recursive_directory_iterator: descend into real
+        // directories only. The link's own type is checked so symlinks and,
+        // on Windows, junctions and other reparse points are never followed
+        if (entry.symlink_status().type() == fs::file_type::directory) {
+            // Subdirectories inherit the parent's device; only mount points
+            // (or every directory, if the mount table is unknown) cost a stat
+            uint64_t childDevice = device;
+            if (m_maxPerMount > 0 &&
+                (!state.haveMountTable ||
+                 state.mountPoints.count(entry.path().string()) > 0)) {
+                childDevice = deviceOf(entry.path());
+            }
+            state.push(self, WorkItem{ entry.path(), childDevice });
+        }
+        else if (fs::is_regular_file(entry.status())) {
+            uintmax_t fileSize = 0;
+            if (state.accept(entry, fileSize)) {
+                found.push_back({ entry.path(), fileSize });
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef PARALLELSCANNER_H
+#define PARALLELSCANNER_H
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <cstdint> // For uintmax_t
+
+// Walks a directory tree with a pool of threads.
+//
+// Each thread lists directories from its own queue and pushes subdirectories
+// back onto it; idle threads steal from the others. Symlinks to directories
+// are not followed, and the first filesystem error stops the walk and is
+// rethrown, matching std::filesystem::recursive_directory_iterator.
+class ParallelScanner {
+public:
+    struct ScannedFile {
+        std::filesystem::path path;
+        uintmax_t size;
+    };
+
+    // Called from worker threads for every regular file. Returns true to keep
+    // the file, filling in its size. Must be safe to call concurrently.
+    using Filter = std::function<bool(const std::filesystem::directory_entry& entry,
+                                      uintmax_t& fileSize)>;
+
+    // Concurrent listings allowed on one device unless told otherwise
+    static constexpr size_t kDefaultMaxPerMount = 8;
+
+    // threads = 0 picks a default from the core count, no more than maxPerMount.
+    // maxPerMount caps concurrent listings on one device (0 = no cap).
+    explicit ParallelScanner(size_t threads = 0,
+                             size_t maxPerMount = kDefaultMaxPerMount);
+
+    // Returns every accepted regular file under root. With sortedOutput the
+    // result is sorted by path, so it does not depend on thread timing.
+    std::vector<ScannedFile> scan(const std::filesystem::path& root,
+                                  const Filter& accept,
+                                  bool sortedOutput) const;
+
+    size_t threads() const { return m_threads; }
+
+private:
+    struct State;
+
+    void run(State& state, size_t self) const;
+    void listDirectory(State& state, size_t self,
+                       const std::filesystem::path& dir, uint64_t device) const;
+
+    size_t m_threads;
+    size_t m_maxPerMount;
+};
+
+#endif // PARALLELSCANNER_H
@@ -7,6 +7,7 @@
 #include <thread>          // For std::thread
 #include <vector>
 #include "BackupManager.h"
+#include "BackupCipher.h"
 #include "ConsoleRedirect.h"
 
 #pragma comment(lib, "shell32.lib") // might be needed for SHBrowseForFolderW
@@ -25,10 +26,15 @@ static HWND hOnceRadio        = nullptr;
 static HWND hDailyRadio       = nullptr;
 static HWND hMonthlyRadio     = nullptr;
 
+static HWND hCopyOrderLabel   = nullptr;
+static HWND hCopyOrderCombo   = nullptr;
+
 static HWND hFileTypesLabel   = nullptr;
 static HWND hFileTypesEdit    = nullptr;  // new
 static HWND hMaxSizeLabel     = nullptr;
 static HWND hMaxSizeEdit      = nullptr;  // new
+static HWND hKeyFileLabel     = nullptr;
+static HWND hKeyFileEdit      = nullptr;
 
 static HWND hConsoleLabel     = nullptr;
 static HWND hConsoleOutput    = nullptr;
@@ -47,6 +53,8 @@ void PickFolder(std::wstring& outFolder);
 void UpdateChosenPathLabel(HWND labelHwnd, const std::wstring& path);
 void OnRadioFrequency(HWND radioClicked);
 void BuildAndRunCommand();
+void RunRestore();
+bool CheckKeyFile(const std::string& keyFile);
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
                    LPSTR lpCmdLine, int nCmdShow)
@@ -68,7 +76,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         wc.lpszClassName,
         L"DartSyncGUI",
         WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, 700, 560,
+        CW_USEDEFAULT, CW_USEDEFAULT, 700, 595,
         nullptr, nullptr, hInstance, nullptr
     );
 
@@ -170,24 +178,38 @@ void BuildAndRunCommand()
         }
     }
 
+    // Grab optional encryption key file
+    wchar_t keyBuf[MAX_PATH];
+    GetWindowTextW(hKeyFileEdit, keyBuf, MAX_PATH);
+    std::wstring wKeyFile(keyBuf);
+    std::string keyFile(wKeyFile.begin(), wKeyFile.end());
+    if (!keyFile.empty() && !CheckKeyFile(keyFile)) {
+        return;
+    }
+
+    // Grab copy order; combo entries follow the CopyOrder enum
+    LRESULT orderIndex = SendMessageW(hCopyOrderCombo, CB_GETCURSEL, 0, 0);
+    CopyOrder copyOrder = (orderIndex == CB_ERR) ? CopyOrder::Auto
+                                                  : (CopyOrder)orderIndex;
+
     std::string sourceNarrow(gSourcePath.begin(), gSourcePath.end());
     std::string destNarrow(gDestPath.begin(), gDestPath.end());
 
     if (gFrequency == L"once") {
         std::cout << "Running one-time backup...\n";
         gBackupManager.backupOnce(sourceNarrow, destNarrow,
-                                  fileTypes, "", maxFileSizeMB);
+                                  fileTypes, "", maxFileSizeMB, copyOrder, keyFile);
     }
     else if (gFrequency == L"daily") {
         std::cout << "Running daily scheduled backup...\n";
         gBackupManager.backupScheduled(sourceNarrow, destNarrow,
-                                       fileTypes, "", maxFileSizeMB,
+                                       fileTypes, "", maxFileSizeMB, copyOrder, keyFile,
                                        "daily", 0);
     }
     else if (gFrequency == L"monthly") {
         std::cout << "Running monthly scheduled backup...\n";
         gBackupManager.backupScheduled(sourceNarrow, destNarrow,
-                                       fileTypes, "", maxFileSizeMB,
+                                       fileTypes, "", maxFileSizeMB, copyOrder, keyFile,
                                        "monthly", 0);
     }
     else {
@@ -195,6 +217,47 @@ void BuildAndRunCommand()
     }
 }
 
+// Loads the key up front so a bad key file shows up in the console window
+// instead of on stderr, which the GUI does not capture
+bool CheckKeyFile(const std::string& keyFile)
+{
+    try {
+        BackupCipher cipher(keyFile);
+    }
+    catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Decrypts the encrypted backup picked as source into the destination folder
+void RunRestore()
+{
+    if (gSourcePath.empty() || gDestPath.empty()) {
+        std::cout << "Error: Pick the encrypted backup as source and a restore destination.\n";
+        return;
+    }
+
+    wchar_t keyBuf[MAX_PATH];
+    GetWindowTextW(hKeyFileEdit, keyBuf, MAX_PATH);
+    std::wstring wKeyFile(keyBuf);
+    if (wKeyFile.empty()) {
+        std::cout << "Error: Restoring an encrypted backup needs its key file.\n";
+        return;
+    }
+
+    std::string sourceNarrow(gSourcePath.begin(), gSourcePath.end());
+    std::string destNarrow(gDestPath.begin(), gDestPath.end());
+    std::string keyFile(wKeyFile.begin(), wKeyFile.end());
+    if (!CheckKeyFile(keyFile)) {
+        return;
+    }
+
+    std::cout << "Running restore...\n";
+    gBackupManager.restoreEncrypted(sourceNarrow, destNarrow, keyFile);
+}
+
 // The Window Procedure
 LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
@@ -278,6 +341,25 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             // Default "Once"
             SendMessageW(hOnceRadio, BM_SETCHECK, BST_CHECKED, 0);
 
+            // Copy order (same row as frequency)
+            hCopyOrderLabel = CreateWindowW(
+                L"STATIC", L"Copy Order:",
+                WS_CHILD | WS_VISIBLE,
+                330, 170, 90, 20,
+                hWnd, nullptr, nullptr, nullptr
+            );
+            hCopyOrderCombo = CreateWindowW(
+                L"COMBOBOX", L"",
+                WS_CHILD | WS_VISIBLE | WS_VSCROLL | CBS_DROPDOWNLIST,
+                420, 165, 160, 150,
+                hWnd, nullptr, nullptr, nullptr
+            );
+            for (const wchar_t* item : { L"Auto", L"Directory", L"Inode",
+                                         L"Extent", L"Size class" }) {
+                SendMessageW(hCopyOrderCombo, CB_ADDSTRING, 0, (LPARAM)item);
+            }
+            SendMessageW(hCopyOrderCombo, CB_SETCURSEL, 0, 0);
+
             // File Types row
             hFileTypesLabel = CreateWindowW(
                 L"STATIC", L"File Extensions (e.g. .dll .txt):",
@@ -314,11 +396,33 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 hWnd, (HMENU)301, nullptr, nullptr
             );
 
+            // Restore button
+            CreateWindowW(
+                L"BUTTON", L"Restore",
+                WS_CHILD | WS_VISIBLE | BS_PUSHBUTTON,
+                460, 235, 100, 30,
+                hWnd, (HMENU)302, nullptr, nullptr
+            );
+
+            // Key File row
+            hKeyFileLabel = CreateWindowW(
+                L"STATIC", L"Encryption Key File (optional):",
+                WS_CHILD | WS_VISIBLE,
+                20, 280, 220, 20,
+                hWnd, nullptr, nullptr, nullptr
+            );
+            hKeyFileEdit = CreateWindowW(
+                L"EDIT", L"",
+                WS_CHILD | WS_VISIBLE | WS_BORDER | ES_AUTOHSCROLL,
+                240, 275, 300, 25,
+                hWnd, nullptr, nullptr, nullptr
+            );
+
             // Console label
             hConsoleLabel = CreateWindowW(
                 L"STATIC", L"Console:",
                 WS_CHILD | WS_VISIBLE,
-                20, 285, 100, 20,
+                20, 320, 100, 20,
                 hWnd, nullptr, nullptr, nullptr
             );
 
@@ -327,7 +431,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 L"EDIT", L"",
                 WS_CHILD | WS_VISIBLE | ES_MULTILINE | ES_AUTOVSCROLL | ES_READONLY |
                 WS_VSCROLL | WS_BORDER,
-                20, 310, 640, 200,
+                20, 345, 640, 200,
                 hWnd, nullptr, nullptr, nullptr
             );
 
@@ -363,6 +467,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 });
                 worker.detach();
             }
+            else if (wmId == 302) {
+                // Restore in background thread
+                std::thread worker([](){
+                    RunRestore();
+                });
+                worker.detach();
+            }
         }
         break;
     case WM_DESTROY: